@@ -0,0 +1,120 @@
+// Compares the in-process SHA-256 kernels with the old `md5sum` popen path.
+//
+// Usage: hash-benchmark [FILE...]
+// Without arguments, temporary files of typical image sizes are generated.
+// Every kernel available on this CPU is first checked against known-answer
+// vectors; the exit status is non-zero if any of them fails.
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "sha256.h"
+
+namespace {
+
+std::string exec(const char *cmd) {
+  std::array<char, 128> buffer;
+  std::string result;
+  std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd, "r"), pclose);
+  if (!pipe) {
+    throw std::runtime_error("popen() failed!");
+  }
+  while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
+    result += buffer.data();
+  }
+  return result;
+}
+
+template <typename F>
+double timeMs(F f) {
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+boost::filesystem::path makeFile(const boost::filesystem::path &dir, uint64_t size) {
+  const boost::filesystem::path path = dir / ("image-" + std::to_string(size));
+  std::ofstream out(path.string(), std::ios::binary);
+  std::mt19937 rng(static_cast<unsigned int>(size));
+  std::vector<uint32_t> chunk(1024 * 1024 / sizeof(uint32_t));
+  for (uint64_t written = 0; written < size; written += chunk.size() * sizeof(uint32_t)) {
+    for (auto &w : chunk) {
+      w = rng();
+    }
+    out.write(reinterpret_cast<const char *>(chunk.data()),
+              static_cast<std::streamsize>(std::min<uint64_t>(size - written, chunk.size() * sizeof(uint32_t))));
+  }
+  return path;
+}
+
+void report(const std::string &what, uint64_t bytes, double ms) {
+  std::cout << std::left << std::setw(32) << what << std::right << std::setw(10) << std::fixed
+            << std::setprecision(1) << ms << " ms" << std::setw(10) << (static_cast<double>(bytes) / 1e6) / (ms / 1e3)
+            << " MB/s\n";
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  bool self_test_ok = true;
+  for (const auto kernel : Sha256::AvailableKernels()) {
+    const bool ok = Sha256::SelfTest(kernel);
+    std::cout << "Self-test " << Sha256::KernelName(kernel) << ": " << (ok ? "passed" : "FAILED") << "\n";
+    self_test_ok = self_test_ok && ok;
+  }
+  std::cout << "Dispatched SHA-256 kernel: " << Sha256::Backend() << "\n\n";
+  if (!self_test_ok) {
+    return 1;
+  }
+
+  std::vector<boost::filesystem::path> files;
+  boost::filesystem::path tmp_dir;
+  if (argc > 1) {
+    files.assign(argv + 1, argv + argc);
+  } else {
+    tmp_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(tmp_dir);
+    for (const uint64_t size : {32ULL * 1024, 4ULL * 1024 * 1024, 64ULL * 1024 * 1024}) {
+      files.push_back(makeFile(tmp_dir, size));
+    }
+  }
+
+
+  uint64_t total = 0;
+  for (const auto &f : files) {
+    const uint64_t size = boost::filesystem::file_size(f);
+    total += size;
+    // Warm the page cache so that every variant reads from memory.
+    Sha256File(f);
+
+    std::cout << f.filename().string() << " (" << size << " bytes)\n";
+    report("  md5sum (popen)", size, timeMs([&]() { exec(("md5sum " + f.string()).c_str()); }));
+    report("  sha256 portable", size, timeMs([&]() { Sha256File(f, Sha256::Kernel::kPortable); }));
+    report("  sha256 " + Sha256::Backend(), size, timeMs([&]() { Sha256File(f); }));
+  }
+
+  std::cout << "\nAll files (" << total << " bytes)\n";
+  report("  md5sum (popen), sequential", total, timeMs([&]() {
+           for (const auto &f : files) {
+             exec(("md5sum " + f.string()).c_str());
+           }
+         }));
+  report("  sha256, sequential", total, timeMs([&]() { Sha256Files(files, 1); }));
+  report("  sha256, concurrent", total,
+         timeMs([&]() { Sha256Files(files, static_cast<unsigned int>(files.size())); }));
+
+  if (!tmp_dir.empty()) {
+    boost::filesystem::remove_all(tmp_dir);
+  }
+  return 0;
+}
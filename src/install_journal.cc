@@ -0,0 +1,139 @@
+#include "install_journal.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "logging/logging.h"
+
+InstallJournal::InstallJournal(const boost::filesystem::path &path) : path_(path) {
+  fd_ = open(path_.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);  // NOLINT(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+  if (fd_ < 0) {
+    throw std::runtime_error("Could not open install journal " + path_.string() + ": " + strerror(errno));
+  }
+}
+
+InstallJournal::~InstallJournal() { close(fd_); }
+
+void InstallJournal::RecordBegin(const std::string &ecu_serial, const std::string &hash_before,
+                                 const std::string &expected) {
+  append("begin " + ecu_serial + " " + (hash_before.empty() ? "-" : hash_before) + " " +
+         (expected.empty() ? "-" : expected));
+}
+
+void InstallJournal::RecordInstalled(const std::string &ecu_serial, bool success) {
+  append("installed " + ecu_serial + (success ? " ok" : " fail"));
+}
+
+void InstallJournal::RecordStep(const std::string &ecu_serial, size_t step) {
+  append("step " + ecu_serial + " " + std::to_string(step));
+}
+
+void InstallJournal::RecordDone(const std::string &ecu_serial, bool success) {
+  append((success ? "done " : "failed ") + ecu_serial);
+}
+
+void InstallJournal::RecordPending(const std::string &ecu_serial, const EcuState &state) {
+  RecordBegin(ecu_serial, state.hash_before, state.expected);
+  if (state.installed) {
+    RecordInstalled(ecu_serial, true);
+  }
+  if (state.steps_done > 0) {
+    RecordStep(ecu_serial, state.steps_done - 1);
+  }
+}
+
+void InstallJournal::append(const std::string &record) {
+  std::lock_guard<std::mutex> guard(m_);
+  buffer_ += record;
+  buffer_ += '\n';
+  ++appended_;
+}
+
+void InstallJournal::Commit() {
+  std::unique_lock<std::mutex> lock(m_);
+  const uint64_t wanted = appended_;
+  while (synced_ < wanted) {
+    // Another thread's sync may already cover our records.
+    if (syncing_) {
+      cv_.wait(lock);
+      continue;
+    }
+    syncing_ = true;
+    std::string data;
+    data.swap(buffer_);
+    const uint64_t batch = appended_;
+    lock.unlock();
+
+    int err = 0;
+    for (size_t off = 0; off < data.size() && err == 0;) {
+      const ssize_t n = write(fd_, data.data() + off, data.size() - off);
+      if (n < 0 && errno != EINTR) {
+        err = errno;
+      } else if (n > 0) {
+        off += static_cast<size_t>(n);
+      }
+    }
+    if (err == 0 && fdatasync(fd_) != 0) {
+      err = errno;
+    }
+
+    lock.lock();
+    syncing_ = false;
+    cv_.notify_all();
+    if (err != 0) {
+      throw std::runtime_error("Could not write install journal " + path_.string() + ": " + strerror(err));
+    }
+    synced_ = batch;
+  }
+}
+
+std::map<std::string, InstallJournal::EcuState> InstallJournal::Pending() const {
+  std::map<std::string, EcuState> pending;
+  std::ifstream in(path_.string());
+  std::string line;
+  // A record torn by a power loss has no trailing newline; getline() still returns it, so check for EOF.
+  while (std::getline(in, line) && !in.eof()) {
+    std::istringstream record(line);
+    std::string type, ecu_serial, arg, expected;
+    record >> type >> ecu_serial >> arg >> expected;
+    if (type == "begin" && !arg.empty()) {
+      EcuState state;
+      state.hash_before = (arg == "-") ? "" : arg;
+      state.expected = (expected == "-") ? "" : expected;
+      pending[ecu_serial] = state;
+    } else if (type == "installed" && (arg == "ok" || arg == "fail")) {
+      auto it = pending.find(ecu_serial);
+      if (it != pending.end() && arg == "ok") {
+        it->second.installed = true;
+      } else {
+        pending.erase(ecu_serial);
+      }
+    } else if (type == "step") {
+      auto it = pending.find(ecu_serial);
+      if (it != pending.end() && !arg.empty() && arg.size() < 10 && arg.find_first_not_of("0123456789") == std::string::npos) {
+        it->second.steps_done = std::stoul(arg) + 1;
+      }
+    } else if (type == "done" || type == "failed") {
+      pending.erase(ecu_serial);
+    } else {
+      LOG_WARNING << "Ignoring corrupted install journal record: " << line;
+    }
+  }
+  return pending;
+}
+
+void InstallJournal::Clear() {
+  std::unique_lock<std::mutex> lock(m_);
+  cv_.wait(lock, [this]() { return !syncing_; });
+  buffer_.clear();
+  if (ftruncate(fd_, 0) != 0 || fdatasync(fd_) != 0) {
+    throw std::runtime_error("Could not clear install journal " + path_.string() + ": " + strerror(errno));
+  }
+  synced_ = appended_;
+}
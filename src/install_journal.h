@@ -0,0 +1,65 @@
+#ifndef INSTALL_JOURNAL_H_
+#define INSTALL_JOURNAL_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+/*
+ * Append-only log of Secondary post-install progress, replayed at startup to
+ * resume the steps a power loss interrupted. Records are buffered in memory;
+ * Commit() writes everything appended so far and syncs it with a single
+ * fdatasync(), so concurrent workers share one sync per batch.
+ */
+class InstallJournal {
+ public:
+  struct EcuState {
+    std::string hash_before;  // firmware hash before libaktualizr installed the update
+    std::string expected;     // hash of the target installed on the ECU, empty if none
+    bool installed{false};    // libaktualizr reported the install on this ECU as successful
+    size_t steps_done{0};     // post-install steps known to have completed
+  };
+
+  explicit InstallJournal(const boost::filesystem::path &path);
+  ~InstallJournal();
+  InstallJournal(const InstallJournal &) = delete;
+  InstallJournal &operator=(const InstallJournal &) = delete;
+
+  void RecordBegin(const std::string &ecu_serial, const std::string &hash_before, const std::string &expected);
+  // Outcome of libaktualizr's install on the ECU; a failed install closes the entry.
+  void RecordInstalled(const std::string &ecu_serial, bool success);
+  void RecordStep(const std::string &ecu_serial, size_t step);
+  // Closes the ECU's entry, whether its post-install steps succeeded or not.
+  void RecordDone(const std::string &ecu_serial, bool success);
+
+  // Appends records that reopen an entry in the given state, e.g. after Clear().
+  void RecordPending(const std::string &ecu_serial, const EcuState &state);
+
+  // Makes every record appended so far durable.
+  void Commit();
+
+  // ECUs whose entry was begun but never closed.
+  std::map<std::string, EcuState> Pending() const;
+
+  // Drops all records, to be called once nothing is pending any more.
+  void Clear();
+
+ private:
+  void append(const std::string &record);
+
+  boost::filesystem::path path_;
+  int fd_;
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::string buffer_;
+  uint64_t appended_{0};
+  uint64_t synced_{0};
+  bool syncing_{false};
+};
+
+#endif  // INSTALL_JOURNAL_H_
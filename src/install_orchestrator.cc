@@ -0,0 +1,134 @@
+#include "install_orchestrator.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "logging/logging.h"
+
+InstallOrchestrator::InstallOrchestrator(unsigned int max_parallel) : max_parallel_(std::max(max_parallel, 1U)) {}
+
+void InstallOrchestrator::AddJob(Job job) { jobs_.push_back(std::move(job)); }
+
+InstallOrchestrator::Graph InstallOrchestrator::buildGraph() const {
+  std::map<std::string, size_t> index;
+  for (size_t i = 0; i < jobs_.size(); ++i) {
+    if (!index.emplace(jobs_[i].id, i).second) {
+      throw std::invalid_argument("Duplicate install job: " + jobs_[i].id);
+    }
+  }
+
+  Graph graph;
+  graph.pending.resize(jobs_.size());
+  graph.dependents.resize(jobs_.size());
+  for (size_t i = 0; i < jobs_.size(); ++i) {
+    for (const auto &dep : jobs_[i].after) {
+      auto it = index.find(dep);
+      if (it == index.end()) {
+        throw std::invalid_argument("Install job " + jobs_[i].id + " depends on unknown ECU " + dep);
+      }
+      graph.dependents[it->second].push_back(i);
+    }
+    graph.pending[i] = jobs_[i].after.size();
+    if (graph.pending[i] == 0) {
+      graph.ready.push_back(i);
+    }
+  }
+
+  // Kahn's algorithm on a copy: every job must become ready at some point.
+  std::vector<size_t> pending = graph.pending;
+  std::deque<size_t> ready = graph.ready;
+  size_t visited = 0;
+  while (!ready.empty()) {
+    const size_t i = ready.front();
+    ready.pop_front();
+    ++visited;
+    for (const size_t d : graph.dependents[i]) {
+      if (--pending[d] == 0) {
+        ready.push_back(d);
+      }
+    }
+  }
+  if (visited != jobs_.size()) {
+    throw std::invalid_argument("Cyclic install ordering between Secondaries");
+  }
+  return graph;
+}
+
+void InstallOrchestrator::Validate() const { buildGraph(); }
+
+std::map<std::string, InstallOrchestrator::JobResult> InstallOrchestrator::Run() {
+  Graph graph = buildGraph();
+  std::vector<size_t> &pending = graph.pending;
+  const std::vector<std::vector<size_t>> &dependents = graph.dependents;
+  std::deque<size_t> &ready = graph.ready;
+  std::vector<bool> blocked(jobs_.size(), false);
+
+  std::map<std::string, JobResult> results;
+  std::mutex m;
+  std::condition_variable cv;
+
+  auto worker = [&]() {
+    std::unique_lock<std::mutex> lock(m);
+    while (true) {
+      cv.wait(lock, [&]() { return !ready.empty() || results.size() == jobs_.size(); });
+      if (ready.empty()) {
+        return;
+      }
+      const size_t i = ready.front();
+      ready.pop_front();
+
+      JobResult result = JobResult::kSkipped;
+      if (blocked[i]) {
+        LOG_WARNING << "Skipping install job " << jobs_[i].id << ": a job it depends on did not succeed";
+      } else {
+        lock.unlock();
+        bool ok = false;
+        try {
+          ok = jobs_[i].run();
+        } catch (const std::exception &e) {
+          LOG_ERROR << "Install job " << jobs_[i].id << " failed: " << e.what();
+        } catch (...) {
+          LOG_ERROR << "Install job " << jobs_[i].id << " failed with an unknown exception";
+        }
+        lock.lock();
+        result = ok ? JobResult::kSuccess : JobResult::kFailure;
+      }
+
+      results[jobs_[i].id] = result;
+      for (const size_t d : dependents[i]) {
+        if (result != JobResult::kSuccess) {
+          blocked[d] = true;
+        }
+        if (--pending[d] == 0) {
+          ready.push_back(d);
+        }
+      }
+      cv.notify_all();
+    }
+  };
+
+  const size_t n_workers = std::min(static_cast<size_t>(max_parallel_), jobs_.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < n_workers; ++i) {
+    workers.emplace_back(worker);
+  }
+  for (auto &t : workers) {
+    t.join();
+  }
+  return results;
+}
+
+std::string JobResultToString(InstallOrchestrator::JobResult result) {
+  switch (result) {
+    case InstallOrchestrator::JobResult::kSuccess:
+      return "success";
+    case InstallOrchestrator::JobResult::kFailure:
+      return "failure";
+    case InstallOrchestrator::JobResult::kSkipped:
+      return "skipped";
+  }
+  return "unknown";
+}
@@ -0,0 +1,52 @@
+#ifndef INSTALL_ORCHESTRATOR_H_
+#define INSTALL_ORCHESTRATOR_H_
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Runs a set of per-ECU install jobs on a bounded pool of worker threads.
+ * A job only starts once every job listed in its `after` set has succeeded;
+ * if one of them fails, the job is skipped, but unrelated jobs keep running.
+ */
+class InstallOrchestrator {
+ public:
+  enum class JobResult { kSuccess, kFailure, kSkipped };
+
+  struct Job {
+    std::string id;
+    std::vector<std::string> after;
+    std::function<bool()> run;
+  };
+
+  explicit InstallOrchestrator(unsigned int max_parallel);
+
+  void AddJob(Job job);
+
+  // Throws std::invalid_argument on duplicate ids, unknown dependencies or cycles.
+  void Validate() const;
+
+  // Blocks until every job has finished or been skipped.
+  std::map<std::string, JobResult> Run();
+
+ private:
+  // Dependency graph over job indices.
+  struct Graph {
+    std::vector<size_t> pending;                 // unfinished dependencies per job
+    std::vector<std::vector<size_t>> dependents;  // jobs waiting on each job
+    std::deque<size_t> ready;                     // jobs without dependencies
+  };
+
+  // Throws std::invalid_argument on duplicate ids, unknown dependencies or cycles.
+  Graph buildGraph() const;
+
+  unsigned int max_parallel_;
+  std::vector<Job> jobs_;
+};
+
+std::string JobResultToString(InstallOrchestrator::JobResult result);
+
+#endif  // INSTALL_ORCHESTRATOR_H_
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -15,6 +16,9 @@
 
 #include "virtualsecondary.h"
 
+#include "update_installer.h"
+#include "update_stager.h"
+
 namespace bpo = boost::program_options;
 
 bpo::variables_map parse_options(int argc, char *argv[]) {
@@ -23,6 +27,9 @@ bpo::variables_map parse_options(int argc, char *argv[]) {
       ("config,c", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "configuration file or directory")
       ("help,h", "print help message")
       ("secondary-configs-dir", bpo::value<boost::filesystem::path>(), "directory containing Secondary ECU configuration files")
+      ("install-jobs", bpo::value<unsigned int>()->default_value(4), "maximum number of Secondaries running post-install steps in parallel")
+      ("stage-campaigns", "pre-fetch and verify campaign updates in the background as soon as they are seen")
+      ("install-window", bpo::value<std::string>(), "daily maintenance window HH:MM-HH:MM for installing staged updates")
       ("loglevel", bpo::value<int>(), "set log level 0-5 (trace, debug, info, warning, error, fatal)");
 
   bpo::variables_map vm;
@@ -75,7 +82,8 @@ void process_event(const std::shared_ptr<event::BaseEvent> &event) {
   }
 }
 
-void initSecondaries(Aktualizr *aktualizr, const boost::filesystem::path& config_file) {
+void initSecondaries(Aktualizr *aktualizr, const boost::filesystem::path& config_file,
+                     std::vector<SecondaryInstallSpec> *install_specs) {
   if (!boost::filesystem::exists(config_file)) {
     throw std::invalid_argument("Specified config file doesn't exist: " + config_file.string());
   }
@@ -96,6 +104,30 @@ void initSecondaries(Aktualizr *aktualizr, const boost::filesystem::path& config
         Primary::VirtualSecondaryConfig sec_cfg(c);
         auto sec = std::make_shared<Primary::VirtualSecondary>(sec_cfg);
         aktualizr->AddSecondary(sec);
+
+        SecondaryInstallSpec spec;
+        spec.ecu_serial = sec_cfg.ecu_serial;
+        spec.firmware_path = sec_cfg.firmware_path;
+        const Json::Value& install_after = c["install_after"];
+        if (!install_after.isNull() && !install_after.isArray()) {
+          throw std::invalid_argument("Secondary " + spec.ecu_serial + ": \"install_after\" must be an array of ECU serials");
+        }
+        for (const auto& after : install_after) {
+          if (!after.isString()) {
+            throw std::invalid_argument("Secondary " + spec.ecu_serial + ": \"install_after\" must be an array of ECU serials");
+          }
+          spec.install_after.push_back(after.asString());
+        }
+        if (!c.isMember("post_install")) {
+          LOG_WARNING << "Secondary " << spec.ecu_serial
+                      << " has no \"post_install\" stages, nothing will run after its firmware is installed";
+        }
+        try {
+          spec.post_install = ParsePostInstallHooks(c["post_install"]);
+        } catch (const std::invalid_argument& e) {
+          throw std::invalid_argument("Secondary " + spec.ecu_serial + ": " + e.what());
+        }
+        install_specs->push_back(spec);
       }
     } else {
       LOG_ERROR << "Unsupported type of Secondary: " << secondary_type << std::endl;
@@ -103,20 +135,6 @@ void initSecondaries(Aktualizr *aktualizr, const boost::filesystem::path& config
   }
 }
 
-// This function is to exec a command in terminal as using system() but returning the result as a string
-std::string exec(const char* cmd) {
-    std::array<char, 128> buffer;
-    std::string result;
-    std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd, "r"), pclose);
-    if (!pipe) {
-        throw std::runtime_error("popen() failed!");
-    }
-    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-        result += buffer.data();
-    }
-    return result;
-}
-
 
 int main(int argc, char *argv[]) {
   logger_init();
@@ -132,9 +150,10 @@ int main(int argc, char *argv[]) {
     auto f_cb = [](const std::shared_ptr<event::BaseEvent> event) { process_event(event); };
     boost::signals2::scoped_connection conn(aktualizr.SetSignalHandler(f_cb));
 
+    std::vector<SecondaryInstallSpec> install_specs;
     if (!config.uptane.secondary_config_file.empty()) {
       try {
-        initSecondaries(&aktualizr, config.uptane.secondary_config_file);
+        initSecondaries(&aktualizr, config.uptane.secondary_config_file, &install_specs);
       } catch (const std::exception &e) {
         LOG_ERROR << "Failed to init Secondaries: " << e.what();
         LOG_ERROR << "Exiting...";
@@ -142,21 +161,29 @@ int main(int argc, char *argv[]) {
       }
     }
 
+    UpdateInstaller installer(aktualizr, install_specs, commandline_map["install-jobs"].as<unsigned int>(),
+                              config.storage.path / "demo-app-install.journal");
+
     aktualizr.Initialize();
+    installer.Resume();
+
+    std::unique_ptr<UpdateStager> stager;
+    if (commandline_map.count("stage-campaigns") != 0) {
+      std::unique_ptr<MaintenanceWindow> window;
+      if (commandline_map.count("install-window") != 0) {
+        window.reset(new MaintenanceWindow(MaintenanceWindow::Parse(commandline_map["install-window"].as<std::string>())));
+      }
+      stager.reset(new UpdateStager(aktualizr, installer, std::move(window)));
+    } else if (commandline_map.count("install-window") != 0) {
+      LOG_WARNING << "--install-window has no effect without --stage-campaigns";
+    }
 
     const char *cmd_list = "Available commands: SendDeviceData, CheckUpdates, Download, Install, CampaignCheck, CampaignAccept, SecArduinoInstall, FullUpdateCycle, Pause, Resume, Abort";
     std::cout << cmd_list << std::endl;
 
     std::vector<Uptane::Target> current_updates;
     std::string buffer;
-    
-    std::string hashfirmwarevirtual_old;
-    std::string hashfirmwarevirtual_new;
-    std::string hashfirmwarearduino_old;
-    std::string hashfirmwarearduino_new;
-    std::string hashfirmwaredisplay_old;
-    std::string hashfirmwaredisplay_new;
-    
+
     while (std::getline(std::cin, buffer)) {
       std::vector<std::string> words;
       boost::algorithm::split(words, buffer, boost::is_any_of("\t "), boost::token_compress_on);
@@ -170,47 +197,19 @@ int main(int argc, char *argv[]) {
       } else if (command == "download") {
         aktualizr.Download(current_updates).get();
       } else if (command == "install") {
-        // Compute the hash of old firmware and see if changes after installation
-        hashfirmwarearduino_old = exec("md5sum /var/sota/arduino-usb/firmware-arduino.bin");
-        hashfirmwarevirtual_old = exec("md5sum /var/sota/virtsec1/firmware-virtual.zip");
-        hashfirmwaredisplay_old = exec("md5sum /var/sota/displayecu/firmware-display.zip");
-        
-        aktualizr.Install(current_updates).get();
-        
-        
-        hashfirmwarearduino_new = exec("md5sum /var/sota/arduino-usb/firmware-arduino.bin");
-        hashfirmwarevirtual_new = exec("md5sum /var/sota/virtsec1/firmware-virtual.zip");
-        hashfirmwaredisplay_new = exec("md5sum /var/sota/displayecu/firmware-display.zip");
-        
-        // If the update is for the virtual secondary, extract the packet, else no
-        if (hashfirmwarevirtual_old == hashfirmwarevirtual_new) {
-        	std::cout << "\nNo updates for virtual secondary\n" << std::endl;
-        }
-        else {
-            std::cout << "\nExtracting the update packet...\n" << std::endl;
-            system("cd /var/sota/virtsec1/ && unzip -o firmware-virtual");
-        }
-        
-        // If the update is for the display ECU, extract the packet and install the update, else no
-        if (hashfirmwaredisplay_old == hashfirmwaredisplay_new) {
-        	std::cout << "\nNo updates for display ECU\n" << std::endl;
-        }
-        else {
-            std::cout << "\nExtracting the update packet for display ECU...\n" << std::endl;
-            system("cd /var/sota/displayecu/ && unzip -o firmware-display");
-            system("python3 /var/sota/displayecu/dashboard_update_routine.py");
+        if (stager) {
+          for (const auto& staged : stager->TakeStaged()) {
+            bool known = false;
+            for (const auto& target : current_updates) {
+              known = known || target.sha256Hash() == staged.sha256Hash();
+            }
+            if (!known) {
+              current_updates.push_back(staged);
+            }
+          }
         }
-                
-        // If change occurs, automatically start installation of firmware in the secondary
-        if (hashfirmwarearduino_old == hashfirmwarearduino_new) {
-            std::cout << "No updates for Arduino secondary to be installed" << std::endl;
-        }
-        else {
-            std::cout << "Starting installation for Arduino secondary...\n" << std::endl;
-            system("avrdude -v -p atmega328p -c arduino -P /dev/ttyACM0 -b 115200 -D -U flash:w:/var/sota/arduino-usb//firmware-arduino.bin:i");
-            std::cout << "\nInstallation completed for Arduino secondary" << std::endl;
-        }
-        
+        installer.Install(current_updates);
+
         current_updates.clear();
         // Force to check again for updates, since otherwise the update procedure is not complete on server side
         auto result = aktualizr.CheckUpdates().get();
@@ -230,9 +229,11 @@ int main(int argc, char *argv[]) {
           //custom_install(handle);
         }
       } else if (command == "secarduinoinstall") {
-        std::cout << "Starting flash for Arduino with AVRdude\n\n\n";
-        system("avrdude -v -p atmega328p -c arduino -P /dev/ttyACM0 -b 115200 -D -U flash:w:/var/sota/arduino-usb//firmware-arduino.bin:i");
-        std::cout << "\n\nExiting, see you next time! \n\n\n";
+        // Runs the flash stage configured for the Arduino Secondary, or another one given by serial
+        const std::string serial = words.size() == 2 ? words.at(1) : "arduino-usb";
+        std::cout << "Starting flash for Secondary " << serial << "\n";
+        const bool ok = installer.RunPostInstallStages(serial, "flash");
+        std::cout << "Flash for Secondary " << serial << ": " << (ok ? "success" : "failure") << std::endl;
       } else if (command == "fullupdatecycle") {
         // Perform automatically a full update cycle
         
@@ -244,39 +245,8 @@ int main(int argc, char *argv[]) {
         aktualizr.Download(current_updates).get();
         
         //Install
-        hashfirmwarearduino_old = exec("md5sum /var/sota/arduino-usb/firmware-arduino.bin");
-        hashfirmwarevirtual_old = exec("md5sum /var/sota/virtsec1/firmware-virtual.zip");
-        hashfirmwaredisplay_old = exec("md5sum /var/sota/displayecu/firmware-display.zip");
-        aktualizr.Install(current_updates).get();
-        
-        hashfirmwarearduino_new = exec("md5sum /var/sota/arduino-usb/firmware-arduino.bin");
-        hashfirmwarevirtual_new = exec("md5sum /var/sota/virtsec1/firmware-virtual.zip");
-        hashfirmwaredisplay_new = exec("md5sum /var/sota/displayecu/firmware-display.zip");
+        installer.Install(current_updates);
 
-        if (hashfirmwarevirtual_old == hashfirmwarevirtual_new) {
-        	std::cout << "\nNo updates for virtual secondary\n" << std::endl;
-        }
-        else {
-            std::cout << "\nExtracting the update packet...\n" << std::endl;
-            system("cd /var/sota/virtsec1/ && unzip -o firmware-virtual");
-        }
-        if (hashfirmwaredisplay_old == hashfirmwaredisplay_new) {
-        	std::cout << "\nNo updates for display ECU\n" << std::endl;
-        }
-        else {
-            std::cout << "\nExtracting the update packet for display ECU...\n" << std::endl;
-            system("cd /var/sota/displayecu/ && unzip -o firmware-display");
-            system("python3 /var/sota/displayecu/dashboard_update_routine.py");
-        }
-        if (hashfirmwarearduino_old == hashfirmwarearduino_new) {
-            std::cout << "No updates for Arduino secondary to be installed" << std::endl;
-        }
-        else {
-            std::cout << "Starting installation for Arduino secondary...\n" << std::endl;
-            system("avrdude -v -p atmega328p -c arduino -P /dev/ttyACM0 -b 115200 -D -U flash:w:/var/sota/arduino-usb//firmware-arduino.bin:i");
-            std::cout << "\nInstallation completed for Arduino secondary" << std::endl;
-        }
-        
         current_updates.clear();
         // Force to check again for updates, since otherwise the update procedure is not complete on server side
         result = aktualizr.CheckUpdates().get();
@@ -0,0 +1,282 @@
+#include "post_install_hooks.h"
+
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <boost/algorithm/string.hpp>
+
+#include "logging/logging.h"
+#include "sha256.h"
+
+extern char **environ;  // NOLINT
+
+namespace {
+
+std::string substitute(std::string value, const HookContext &context) {
+  boost::algorithm::replace_all(value, "${firmware_dir}", context.firmware_path.parent_path().string());
+  boost::algorithm::replace_all(value, "${firmware}", context.firmware_path.string());
+  boost::algorithm::replace_all(value, "${ecu_serial}", context.ecu_serial);
+  return value;
+}
+
+std::mutex &namedLock(const std::string &name) {
+  static std::mutex registry_mutex;
+  static std::map<std::string, std::mutex> locks;
+  std::lock_guard<std::mutex> guard(registry_mutex);
+  return locks[name];
+}
+
+bool verifyFirmware(const HookContext &context) {
+  const std::string hash = Sha256File(context.firmware_path);
+  if (hash.empty()) {
+    LOG_ERROR << "Firmware " << context.firmware_path << " of Secondary " << context.ecu_serial << " is missing";
+    return false;
+  }
+  if (!context.expected_sha256.empty() && !boost::algorithm::iequals(hash, context.expected_sha256)) {
+    LOG_ERROR << "Firmware " << context.firmware_path << " does not match the installed target: " << hash
+              << " != " << context.expected_sha256;
+    return false;
+  }
+  return true;
+}
+
+bool extractArchive(const boost::filesystem::path &archive_path, const boost::filesystem::path &destination) {
+  struct archive *in = archive_read_new();
+  archive_read_support_format_all(in);
+  archive_read_support_filter_all(in);
+  struct archive *out = archive_write_disk_new();
+  archive_write_disk_set_options(out, ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_SECURE_NODOTDOT |
+                                          ARCHIVE_EXTRACT_SECURE_SYMLINKS);
+  archive_write_disk_set_standard_lookup(out);
+
+  bool ok = archive_read_open_filename(in, archive_path.c_str(), 64 * 1024) == ARCHIVE_OK;
+  if (!ok) {
+    LOG_ERROR << "Could not open " << archive_path << ": " << archive_error_string(in);
+  }
+
+  struct archive_entry *entry;
+  while (ok) {
+    int r = archive_read_next_header(in, &entry);
+    if (r == ARCHIVE_EOF) {
+      break;
+    }
+    if (r < ARCHIVE_WARN) {
+      LOG_ERROR << "Could not read " << archive_path << ": " << archive_error_string(in);
+      ok = false;
+      break;
+    }
+
+    const boost::filesystem::path target = destination / archive_entry_pathname(entry);
+    archive_entry_set_pathname(entry, target.c_str());
+    const char *hardlink = archive_entry_hardlink(entry);
+    if (hardlink != nullptr) {
+      archive_entry_set_hardlink(entry, (destination / hardlink).c_str());
+    }
+
+    if (archive_write_header(out, entry) < ARCHIVE_WARN) {
+      LOG_ERROR << "Could not extract " << target << ": " << archive_error_string(out);
+      ok = false;
+      break;
+    }
+    if (archive_entry_size(entry) > 0) {
+      const void *block;
+      size_t size;
+      int64_t offset;
+      while ((r = archive_read_data_block(in, &block, &size, &offset)) == ARCHIVE_OK) {
+        if (archive_write_data_block(out, block, size, offset) < ARCHIVE_WARN) {
+          r = ARCHIVE_FATAL;
+          break;
+        }
+      }
+      if (r != ARCHIVE_EOF) {
+        LOG_ERROR << "Could not extract " << target << ": " << archive_error_string(r == ARCHIVE_FATAL ? out : in);
+        ok = false;
+        break;
+      }
+    }
+    if (archive_write_finish_entry(out) < ARCHIVE_WARN) {
+      LOG_ERROR << "Could not extract " << target << ": " << archive_error_string(out);
+      ok = false;
+    }
+  }
+
+  archive_read_free(in);
+  archive_write_free(out);
+  return ok;
+}
+
+bool runCommand(const std::vector<std::string> &command, std::chrono::seconds timeout) {
+  std::vector<char *> argv;
+  for (const auto &arg : command) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  // A process group of its own lets a timeout also kill whatever the command started, e.g. under /bin/sh -c
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attr, 0);
+  pid_t pid;
+  const int err = posix_spawnp(&pid, argv[0], nullptr, &attr, argv.data(), environ);
+  posix_spawnattr_destroy(&attr);
+  if (err != 0) {
+    LOG_ERROR << "Could not start " << command[0] << ": " << strerror(err);
+    return false;
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  int status = 0;
+  while (true) {
+    const pid_t r = waitpid(pid, &status, timeout.count() > 0 ? WNOHANG : 0);
+    if (r == pid) {
+      break;
+    }
+    if (r < 0 && errno != EINTR) {
+      LOG_ERROR << "Could not wait for " << command[0] << ": " << strerror(errno);
+      return false;
+    }
+    if (r == 0) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        kill(-pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        LOG_ERROR << command[0] << " timed out after " << timeout.count() << " s";
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+  }
+
+  if (WIFSIGNALED(status)) {
+    LOG_ERROR << command[0] << " was killed by signal " << WTERMSIG(status);
+    return false;
+  }
+  if (WEXITSTATUS(status) != 0) {
+    LOG_ERROR << command[0] << " exited with code " << WEXITSTATUS(status);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+HookStage HookStage::FromJson(const Json::Value &json) {
+  if (!json.isObject()) {
+    throw std::invalid_argument("Post-install stage must be an object");
+  }
+
+  HookStage stage;
+  if (json.isMember("builtin") == json.isMember("command")) {
+    throw std::invalid_argument("Post-install stage needs exactly one of \"builtin\" and \"command\"");
+  }
+  if (json.isMember("builtin")) {
+    const std::string builtin = json["builtin"].asString();
+    if (builtin == "verify") {
+      stage.type = Type::kVerify;
+    } else if (builtin == "extract") {
+      stage.type = Type::kExtract;
+    } else {
+      throw std::invalid_argument("Unknown built-in post-install stage: " + builtin);
+    }
+    stage.name = builtin;
+  } else {
+    const Json::Value &command = json["command"];
+    if (command.isString()) {
+      stage.command = {"/bin/sh", "-c", command.asString()};
+    } else if (command.isArray() && !command.empty()) {
+      for (const auto &arg : command) {
+        if (!arg.isString()) {
+          throw std::invalid_argument("Post-install command arguments must be strings");
+        }
+        stage.command.push_back(arg.asString());
+      }
+    } else {
+      throw std::invalid_argument("Post-install command must be a string or a non-empty array");
+    }
+    stage.name = boost::filesystem::path(stage.command[0]).filename().string();
+  }
+
+  stage.name = json.get("name", stage.name).asString();
+  stage.destination = json.get("destination", stage.destination).asString();
+  const Json::Value timeout = json.get("timeout", 0);
+  const Json::Value retries = json.get("retries", 0);
+  if (!timeout.isInt() || timeout.asInt() < 0 || !retries.isInt() || retries.asInt() < 0) {
+    throw std::invalid_argument("Post-install stage " + stage.name + ": timeout and retries must be non-negative");
+  }
+  stage.timeout = std::chrono::seconds(timeout.asInt());
+  stage.retries = retries.asUInt();
+  stage.lock = json.get("lock", "").asString();
+  return stage;
+}
+
+bool HookStage::Run(const HookContext &context) const {
+  std::unique_lock<std::mutex> guard;
+  if (!lock.empty()) {
+    guard = std::unique_lock<std::mutex>(namedLock(lock));
+  }
+
+  for (unsigned int attempt = 0; attempt <= retries; ++attempt) {
+    if (attempt > 0) {
+      LOG_WARNING << "Retrying stage " << name << " for Secondary " << context.ecu_serial << " (" << attempt << "/"
+                  << retries << ")";
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    bool ok = false;
+    // e.g. an unreadable firmware file; counts as a failed attempt like any other
+    try {
+      switch (type) {
+        case Type::kVerify:
+          ok = verifyFirmware(context);
+          break;
+        case Type::kExtract:
+          ok = extractArchive(context.firmware_path, substitute(destination, context));
+          break;
+        case Type::kCommand: {
+          std::vector<std::string> argv;
+          for (const auto &arg : command) {
+            argv.push_back(substitute(arg, context));
+          }
+          ok = runCommand(argv, timeout);
+          break;
+        }
+      }
+    } catch (const std::exception &e) {
+      LOG_ERROR << "Stage " << name << " for Secondary " << context.ecu_serial << " failed: " << e.what();
+    }
+    const auto elapsed =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    LOG_INFO << "Stage " << name << " for Secondary " << context.ecu_serial << (ok ? " completed" : " failed")
+             << " in " << elapsed.count() << " ms";
+    if (ok) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<HookStage> ParsePostInstallHooks(const Json::Value &json) {
+  std::vector<HookStage> stages;
+  if (json.isNull()) {
+    return stages;
+  }
+  if (!json.isArray()) {
+    throw std::invalid_argument("\"post_install\" must be an array of stages");
+  }
+  for (const auto &stage : json) {
+    stages.push_back(HookStage::FromJson(stage));
+  }
+  return stages;
+}
@@ -0,0 +1,48 @@
+#ifndef POST_INSTALL_HOOKS_H_
+#define POST_INSTALL_HOOKS_H_
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include "json/json.h"
+
+// What a post-install stage knows about the Secondary it runs for.
+struct HookContext {
+  std::string ecu_serial;
+  boost::filesystem::path firmware_path;
+  // SHA-256 of the installed target, empty if unknown.
+  std::string expected_sha256;
+};
+
+/*
+ * One stage of a Secondary's post-install pipeline, e.g.
+ *   {"name": "extract", "builtin": "extract", "destination": "${firmware_dir}"}
+ *   {"name": "flash", "command": ["avrdude", "-P", "/dev/ttyACM0", ...], "timeout": 120, "retries": 2, "lock": "usb"}
+ * Built-in stages run in-process; command stages are spawned without a shell
+ * unless given as a single string. ${firmware}, ${firmware_dir} and
+ * ${ecu_serial} are substituted in commands and destinations. Stages sharing
+ * a lock never run at the same time, even for different Secondaries.
+ */
+struct HookStage {
+  enum class Type { kVerify, kExtract, kCommand };
+
+  static HookStage FromJson(const Json::Value &json);
+
+  // Runs the stage, retrying on failure. Returns false if every attempt failed.
+  bool Run(const HookContext &context) const;
+
+  std::string name;
+  Type type{Type::kCommand};
+  std::vector<std::string> command;
+  std::string destination{"${firmware_dir}"};
+  std::chrono::seconds timeout{0};  // command stages only, 0 means no timeout
+  unsigned int retries{0};
+  std::string lock;
+};
+
+// Parses the "post_install" array of a Secondary config entry; throws std::invalid_argument on errors.
+std::vector<HookStage> ParsePostInstallHooks(const Json::Value &json);
+
+#endif  // POST_INSTALL_HOOKS_H_
@@ -0,0 +1,345 @@
+#include "sha256.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+#include "sha256_kernels.h"
+
+const uint32_t kSha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+namespace {
+
+const uint32_t kInitialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+void compressPortable(uint32_t *state, const uint8_t *data, size_t blocks) {
+  uint32_t w[64];
+  for (; blocks > 0; --blocks, data += 64) {
+    for (int i = 0; i < 16; ++i) {
+      w[i] = (static_cast<uint32_t>(data[4 * i]) << 24) | (static_cast<uint32_t>(data[4 * i + 1]) << 16) |
+             (static_cast<uint32_t>(data[4 * i + 2]) << 8) | static_cast<uint32_t>(data[4 * i + 3]);
+    }
+    for (int i = 16; i < 64; ++i) {
+      const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+      const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + kSha256K[i] + w[i];
+      const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+bool cpuHasShaNi() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0 || (ecx & bit_SSE4_1) == 0 || (ecx & bit_SSSE3) == 0) {
+    return false;
+  }
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0) {
+    return false;
+  }
+  return (ebx & (1U << 29)) != 0;
+#else
+  return false;
+#endif
+}
+
+bool cpuHasArmv8Sha2() {
+#if defined(__aarch64__) && defined(__linux__)
+  return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+  return false;
+#endif
+}
+
+Sha256::CompressFn kernelFunction(Sha256::Kernel kernel) {
+  switch (kernel) {
+    case Sha256::Kernel::kPortable:
+      return compressPortable;
+    case Sha256::Kernel::kShaNi:
+      return cpuHasShaNi() ? sha256ShaNiKernel() : nullptr;
+    case Sha256::Kernel::kArmv8:
+      return cpuHasArmv8Sha2() ? sha256Armv8Kernel() : nullptr;
+    case Sha256::Kernel::kAuto:
+      break;
+  }
+  return nullptr;
+}
+
+struct KnownAnswer {
+  char fill;
+  size_t length;
+  const char *digest;
+};
+
+// Edge cases around the padding boundary, multi-block and multi-megabyte inputs.
+const KnownAnswer kKnownAnswers[] = {
+    {'a', 0, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {'a', 55, "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318"},
+    {'a', 56, "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a"},
+    {'a', 63, "7d3e74a05d7db15bce4ad9ec0658ea98e3f06eeecf16b4c6fff2da457ddc2f34"},
+    {'a', 64, "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb"},
+    {'a', 65, "635361c48bb9eab14198e76ea8ab7f1a41685d6ad62aa9146d301d4f17eb0ae0"},
+    {'a', 1000, "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3"},
+    {'a', 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+};
+
+std::string digestOf(Sha256::Kernel kernel, const uint8_t *data, size_t len, size_t chunk) {
+  Sha256 hasher(kernel);
+  for (size_t off = 0; off < len; off += chunk) {
+    hasher.Update(data + off, std::min(chunk, len - off));
+  }
+  return hasher.HexDigest();
+}
+
+struct Dispatch {
+  Sha256::Kernel kernel;
+  Sha256::CompressFn fn;
+};
+
+Dispatch selectKernel() {
+  for (const auto kernel : {Sha256::Kernel::kShaNi, Sha256::Kernel::kArmv8}) {
+    if (kernelFunction(kernel) != nullptr && Sha256::SelfTest(kernel)) {
+      return {kernel, kernelFunction(kernel)};
+    }
+  }
+  return {Sha256::Kernel::kPortable, compressPortable};
+}
+
+const Dispatch &dispatch() {
+  static const Dispatch d = selectKernel();
+  return d;
+}
+
+}  // namespace
+
+Sha256::Sha256(Kernel kernel) : compress_(kernel == Kernel::kAuto ? dispatch().fn : kernelFunction(kernel)) {
+  if (compress_ == nullptr) {
+    throw std::invalid_argument("SHA-256 kernel " + KernelName(kernel) + " is not available on this CPU");
+  }
+  std::copy(kInitialState, kInitialState + 8, state_);
+}
+
+void Sha256::Update(const uint8_t *data, size_t len) {
+  total_len_ += len;
+  if (block_len_ != 0) {
+    const size_t n = std::min(len, sizeof(block_) - block_len_);
+    memcpy(block_ + block_len_, data, n);
+    block_len_ += n;
+    data += n;
+    len -= n;
+    if (block_len_ < sizeof(block_)) {
+      return;
+    }
+    compress_(state_, block_, 1);
+    block_len_ = 0;
+  }
+  if (len >= 64) {
+    compress_(state_, data, len / 64);
+    data += len & ~static_cast<size_t>(63);
+    len &= 63;
+  }
+  memcpy(block_, data, len);
+  block_len_ = len;
+}
+
+std::string Sha256::HexDigest() {
+  const uint64_t bit_len = total_len_ * 8;
+  uint8_t pad[72] = {0x80};
+  const size_t pad_len = (block_len_ < 56 ? 56 : 120) - block_len_;
+  for (int i = 0; i < 8; ++i) {
+    pad[pad_len + i] = static_cast<uint8_t>(bit_len >> (56 - 8 * i));
+  }
+  Update(pad, pad_len + 8);
+
+  static const char *hex = "0123456789abcdef";
+  std::string digest;
+  digest.reserve(64);
+  for (const uint32_t word : state_) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+      digest += hex[(word >> shift) & 0xf];
+    }
+  }
+  return digest;
+}
+
+std::string Sha256::Backend() { return KernelName(dispatch().kernel); }
+
+std::string Sha256::KernelName(Kernel kernel) {
+  switch (kernel) {
+    case Kernel::kAuto:
+      return "auto";
+    case Kernel::kPortable:
+      return "portable";
+    case Kernel::kShaNi:
+      return "sha-ni";
+    case Kernel::kArmv8:
+      return "armv8-ce";
+  }
+  return "unknown";
+}
+
+std::vector<Sha256::Kernel> Sha256::AvailableKernels() {
+  std::vector<Kernel> kernels;
+  for (const auto kernel : {Kernel::kPortable, Kernel::kShaNi, Kernel::kArmv8}) {
+    if (kernelFunction(kernel) != nullptr) {
+      kernels.push_back(kernel);
+    }
+  }
+  return kernels;
+}
+
+bool Sha256::SelfTest(Kernel kernel) {
+  if (kernel == Kernel::kAuto || kernelFunction(kernel) == nullptr) {
+    return false;
+  }
+
+  for (const auto &answer : kKnownAnswers) {
+    const std::vector<uint8_t> input(answer.length, static_cast<uint8_t>(answer.fill));
+    // One call and odd-sized pieces, to cover the buffering in Update() too
+    if (digestOf(kernel, input.data(), input.size(), input.size() + 1) != answer.digest ||
+        digestOf(kernel, input.data(), input.size(), 7) != answer.digest) {
+      return false;
+    }
+  }
+  const uint8_t abc[] = {'a', 'b', 'c'};
+  if (digestOf(kernel, abc, sizeof(abc), 1) != "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") {
+    return false;
+  }
+
+  // Pseudo-random data of every length up to a few blocks, against the portable kernel
+  std::vector<uint8_t> data(1024);
+  uint32_t x = 0x12345678;
+  for (auto &b : data) {
+    x = x * 1664525 + 1013904223;
+    b = static_cast<uint8_t>(x >> 24);
+  }
+  for (size_t len = 0; len <= data.size(); len += (len < 200 ? 1 : 37)) {
+    if (digestOf(kernel, data.data(), len, 61) != digestOf(Kernel::kPortable, data.data(), len, len + 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string Sha256File(const boost::filesystem::path &path, Sha256::Kernel kernel) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);  // NOLINT(cppcoreguidelines-pro-type-vararg, hicpp-vararg)
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return "";
+    }
+    throw std::runtime_error("Could not open " + path.string() + ": " + strerror(errno));
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  Sha256 hasher(kernel);
+  std::vector<uint8_t> buffer(1024 * 1024);
+  while (true) {
+    const ssize_t n = read(fd, buffer.data(), buffer.size());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      const int err = errno;
+      close(fd);
+      throw std::runtime_error("Could not read " + path.string() + ": " + strerror(err));
+    }
+    if (n == 0) {
+      break;
+    }
+    hasher.Update(buffer.data(), static_cast<size_t>(n));
+  }
+  close(fd);
+  return hasher.HexDigest();
+}
+
+std::vector<std::string> Sha256Files(const std::vector<boost::filesystem::path> &paths, unsigned int max_parallel,
+                                     std::vector<std::string> *errors) {
+  std::vector<std::string> hashes(paths.size());
+  std::vector<std::exception_ptr> failures(paths.size());
+  std::atomic<size_t> next{0};
+
+  auto worker = [&]() {
+    for (size_t i = next++; i < paths.size(); i = next++) {
+      try {
+        hashes[i] = Sha256File(paths[i]);
+      } catch (...) {
+        failures[i] = std::current_exception();
+      }
+    }
+  };
+
+  const size_t n_workers = std::min(static_cast<size_t>(std::max(max_parallel, 1U)), paths.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < n_workers; ++i) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : workers) {
+    t.join();
+  }
+
+  if (errors != nullptr) {
+    errors->assign(paths.size(), "");
+  }
+  for (size_t i = 0; i < failures.size(); ++i) {
+    if (!failures[i]) {
+      continue;
+    }
+    if (errors == nullptr) {
+      std::rethrow_exception(failures[i]);
+    }
+    try {
+      std::rethrow_exception(failures[i]);
+    } catch (const std::exception &e) {
+      (*errors)[i] = e.what();
+    }
+  }
+  return hashes;
+}
@@ -0,0 +1,55 @@
+#ifndef SHA256_H_
+#define SHA256_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+/*
+ * Streaming SHA-256. The block function is picked once at runtime: SHA-NI
+ * on x86, the ARMv8 crypto extensions on aarch64, portable C++ otherwise.
+ * A hardware kernel is only used if it passes SelfTest().
+ */
+class Sha256 {
+ public:
+  enum class Kernel { kAuto, kPortable, kShaNi, kArmv8 };
+
+  // Throws std::invalid_argument if the kernel is not available on this CPU.
+  explicit Sha256(Kernel kernel = Kernel::kAuto);
+
+  void Update(const uint8_t *data, size_t len);
+  // Finalises the hash; the object must not be updated afterwards.
+  std::string HexDigest();
+
+  // Name of the block function used by Kernel::kAuto.
+  static std::string Backend();
+
+  static std::string KernelName(Kernel kernel);
+  // Kernels built in and supported by this CPU, kPortable included.
+  static std::vector<Kernel> AvailableKernels();
+  // Checks a kernel against known-answer vectors and against the portable kernel.
+  static bool SelfTest(Kernel kernel);
+
+  using CompressFn = void (*)(uint32_t *state, const uint8_t *data, size_t blocks);
+
+ private:
+  CompressFn compress_;
+  uint32_t state_[8];
+  uint8_t block_[64];
+  size_t block_len_{0};
+  uint64_t total_len_{0};
+};
+
+// Lower-case hex SHA-256 of a file, or an empty string if it does not exist.
+std::string Sha256File(const boost::filesystem::path &path, Sha256::Kernel kernel = Sha256::Kernel::kAuto);
+
+// Hashes several files concurrently on up to max_parallel threads. Results are in input order.
+// If errors is given, a file that cannot be read gets an empty hash and its error message
+// at the same index; otherwise the first error is thrown.
+std::vector<std::string> Sha256Files(const std::vector<boost::filesystem::path> &paths, unsigned int max_parallel,
+                                     std::vector<std::string> *errors = nullptr);
+
+#endif  // SHA256_H_
@@ -0,0 +1,47 @@
+#include "sha256_kernels.h"
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+
+#include <arm_neon.h>
+
+namespace {
+
+void compressArmv8(uint32_t *state, const uint8_t *data, size_t blocks) {
+  uint32x4_t state0 = vld1q_u32(&state[0]);
+  uint32x4_t state1 = vld1q_u32(&state[4]);
+
+  for (; blocks > 0; --blocks, data += 64) {
+    const uint32x4_t abcd_save = state0;
+    const uint32x4_t efgh_save = state1;
+    uint32x4_t w[4];
+
+    for (int i = 0; i < 16; ++i) {
+      if (i < 4) {
+        w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+      } else {
+        const uint32x4_t x = vsha256su0q_u32(w[i % 4], w[(i + 1) % 4]);
+        w[i % 4] = vsha256su1q_u32(x, w[(i + 2) % 4], w[(i + 3) % 4]);
+      }
+      const uint32x4_t msg = vaddq_u32(w[i % 4], vld1q_u32(&kSha256K[4 * i]));
+      const uint32x4_t abcd = state0;
+      state0 = vsha256hq_u32(state0, state1, msg);
+      state1 = vsha256h2q_u32(state1, abcd, msg);
+    }
+
+    state0 = vaddq_u32(state0, abcd_save);
+    state1 = vaddq_u32(state1, efgh_save);
+  }
+
+  vst1q_u32(&state[0], state0);
+  vst1q_u32(&state[4], state1);
+}
+
+}  // namespace
+
+Sha256::CompressFn sha256Armv8Kernel() { return compressArmv8; }
+
+#else
+
+Sha256::CompressFn sha256Armv8Kernel() { return nullptr; }
+
+#endif
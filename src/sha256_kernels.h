@@ -0,0 +1,15 @@
+#ifndef SHA256_KERNELS_H_
+#define SHA256_KERNELS_H_
+
+#include <cstdint>
+
+#include "sha256.h"
+
+extern const uint32_t kSha256K[64];
+
+// Hardware block functions, nullptr when the file was built without the
+// matching compiler flags. CPU support is checked by the caller.
+Sha256::CompressFn sha256ShaNiKernel();
+Sha256::CompressFn sha256Armv8Kernel();
+
+#endif  // SHA256_KERNELS_H_
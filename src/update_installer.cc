@@ -0,0 +1,282 @@
+#include "update_installer.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+
+#include <boost/algorithm/string.hpp>
+
+#include "install_orchestrator.h"
+#include "logging/logging.h"
+#include "sha256.h"
+
+namespace {
+
+// Journaled in place of the pre-install hash when the firmware could not be read
+const char *const kUnknownHash = "unknown";
+
+}  // namespace
+
+UpdateInstaller::UpdateInstaller(Aktualizr &aktualizr, std::vector<SecondaryInstallSpec> secondaries,
+                                 unsigned int max_parallel, const boost::filesystem::path &journal_path)
+    : aktualizr_(aktualizr),
+      secondaries_(std::move(secondaries)),
+      max_parallel_(max_parallel),
+      journal_(journal_path) {
+  // Reject bad ordering specs at startup rather than after an install.
+  InstallOrchestrator orchestrator(max_parallel_);
+  for (const auto &spec : secondaries_) {
+    orchestrator.AddJob({spec.ecu_serial, spec.install_after, nullptr});
+  }
+  orchestrator.Validate();
+
+  conn_ = aktualizr_.SetSignalHandler([this](const std::shared_ptr<event::BaseEvent> &event) { onEvent(event); });
+}
+
+void UpdateInstaller::onEvent(const std::shared_ptr<event::BaseEvent> &event) {
+  if (!event->isTypeOf<event::InstallTargetComplete>()) {
+    return;
+  }
+  const auto install_complete = dynamic_cast<event::InstallTargetComplete *>(event.get());
+  const std::string serial = install_complete->serial.ToString();
+  {
+    std::lock_guard<std::mutex> guard(results_mutex_);
+    if (!installing_) {
+      return;
+    }
+    install_results_[serial] = install_complete->success;
+  }
+  // Durable before libaktualizr moves on to the next ECU of the batch, see Resume()
+  try {
+    journal_.RecordInstalled(serial, install_complete->success);
+    journal_.Commit();
+  } catch (const std::exception &e) {
+    LOG_ERROR << "Could not journal the install result of Secondary " << serial << ": " << e.what();
+  }
+}
+
+void UpdateInstaller::Install(const std::vector<Uptane::Target> &updates) {
+  std::lock_guard<std::mutex> guard(install_mutex_);
+
+  // Compute the hash of old firmware and see if changes after installation
+  std::vector<boost::filesystem::path> firmware_paths;
+  for (const auto &spec : secondaries_) {
+    firmware_paths.push_back(spec.firmware_path);
+  }
+  std::vector<std::string> errors;
+  std::vector<std::string> hashes = Sha256Files(firmware_paths, max_parallel_, &errors);
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    if (!errors[i].empty()) {
+      LOG_ERROR << "Could not hash firmware of Secondary " << secondaries_[i].ecu_serial << ": " << errors[i];
+      hashes[i] = kUnknownHash;
+    }
+  }
+
+  std::map<std::string, std::string> expected;
+  for (const auto &target : updates) {
+    for (const auto &ecu : target.ecus()) {
+      expected[ecu.first.ToString()] = target.sha256Hash();
+    }
+  }
+
+  // The old hashes must survive a power loss during the install, see Resume()
+  const std::map<std::string, InstallJournal::EcuState> left_over = journal_.Pending();
+  std::map<std::string, InstallJournal::EcuState> ecus;
+  for (size_t i = 0; i < secondaries_.size(); ++i) {
+    const std::string &serial = secondaries_[i].ecu_serial;
+    auto prev = left_over.find(serial);
+    if (prev != left_over.end() && expected[serial].empty()) {
+      // Skipped by an earlier run and not updated again: retry its remaining steps
+      ecus[serial] = prev->second;
+      journal_.RecordPending(serial, prev->second);
+      continue;
+    }
+    ecus[serial].hash_before = hashes[i];
+    ecus[serial].expected = expected[serial];
+    journal_.RecordBegin(serial, hashes[i], expected[serial]);
+  }
+  journal_.Commit();
+
+  {
+    std::lock_guard<std::mutex> results_guard(results_mutex_);
+    install_results_.clear();
+    installing_ = true;
+  }
+  try {
+    aktualizr_.Install(updates).get();
+  } catch (...) {
+    std::lock_guard<std::mutex> results_guard(results_mutex_);
+    installing_ = false;
+    throw;
+  }
+  std::map<std::string, bool> results;
+  {
+    std::lock_guard<std::mutex> results_guard(results_mutex_);
+    installing_ = false;
+    results.swap(install_results_);
+  }
+
+  // Already journaled by onEvent()
+  for (auto &ecu : ecus) {
+    auto it = results.find(ecu.first);
+    if (it != results.end()) {
+      ecu.second.installed = it->second;
+    }
+  }
+
+  runPostInstall(ecus);
+}
+
+void UpdateInstaller::Resume() {
+  std::lock_guard<std::mutex> guard(install_mutex_);
+
+  std::map<std::string, InstallJournal::EcuState> pending = journal_.Pending();
+  for (auto it = pending.begin(); it != pending.end();) {
+    if (!it->second.installed && firmwareMatches(it->first, it->second.expected)) {
+      // Written before the power loss, but its InstallTargetComplete was not journaled in time
+      LOG_INFO << "Firmware of Secondary " << it->first << " already matches its update";
+      it->second.installed = true;
+    }
+    if (it->second.installed) {
+      ++it;
+      continue;
+    }
+    // Not written, so libaktualizr offers the update again; the entry is closed by runPostInstall()
+    LOG_WARNING << "Install on Secondary " << it->first
+                << " was interrupted by a restart, leaving it for a re-install";
+    it = pending.erase(it);
+  }
+  if (!pending.empty()) {
+    LOG_INFO << "Resuming post-install steps of " << pending.size() << " Secondaries interrupted by a restart";
+  }
+  runPostInstall(pending);
+}
+
+bool UpdateInstaller::firmwareMatches(const std::string &ecu_serial, const std::string &expected) const {
+  if (expected.empty()) {
+    return false;
+  }
+  for (const auto &spec : secondaries_) {
+    if (spec.ecu_serial != ecu_serial) {
+      continue;
+    }
+    try {
+      return boost::algorithm::iequals(Sha256File(spec.firmware_path), expected);
+    } catch (const std::exception &e) {
+      LOG_ERROR << "Could not hash firmware of Secondary " << ecu_serial << ": " << e.what();
+      return false;
+    }
+  }
+  return false;
+}
+
+bool UpdateInstaller::RunPostInstallStages(const std::string &ecu_serial, const std::string &stage_name) {
+  std::lock_guard<std::mutex> guard(install_mutex_);
+
+  auto spec = std::find_if(secondaries_.cbegin(), secondaries_.cend(),
+                           [&ecu_serial](const SecondaryInstallSpec &s) { return s.ecu_serial == ecu_serial; });
+  if (spec == secondaries_.cend()) {
+    LOG_ERROR << "Unknown Secondary: " << ecu_serial;
+    return false;
+  }
+  if (spec->post_install.empty()) {
+    LOG_ERROR << "Secondary " << ecu_serial << " has no post-install stages";
+    return false;
+  }
+
+  std::vector<HookStage> stages;
+  for (const auto &stage : spec->post_install) {
+    if (stage.name == stage_name) {
+      stages.push_back(stage);
+    }
+  }
+  if (stages.empty()) {
+    LOG_INFO << "Secondary " << ecu_serial << " has no " << stage_name << " stage, running its whole pipeline";
+    stages = spec->post_install;
+  }
+
+  const HookContext context{spec->ecu_serial, spec->firmware_path, ""};
+  for (const auto &stage : stages) {
+    if (!stage.Run(context)) {
+      LOG_ERROR << "Post-install stage " << stage.name << " for Secondary " << ecu_serial << " failed";
+      return false;
+    }
+  }
+  return true;
+}
+
+void UpdateInstaller::runPostInstall(const std::map<std::string, InstallJournal::EcuState> &ecus) {
+  InstallOrchestrator orchestrator(max_parallel_);
+  for (const auto &spec : secondaries_) {
+    auto it = ecus.find(spec.ecu_serial);
+    if (it == ecus.end()) {
+      continue;
+    }
+    // Secondaries with nothing left to do do not hold anyone back
+    std::vector<std::string> after;
+    for (const auto &dep : spec.install_after) {
+      if (ecus.count(dep) != 0) {
+        after.push_back(dep);
+      }
+    }
+    const SecondaryInstallSpec *s = &spec;
+    const InstallJournal::EcuState state = it->second;
+    orchestrator.AddJob({spec.ecu_serial, after, [this, s, state]() {
+                           const bool ok = postInstall(*s, state);
+                           journal_.RecordDone(s->ecu_serial, ok);
+                           journal_.Commit();
+                           return ok;
+                         }});
+  }
+
+  std::map<std::string, InstallJournal::EcuState> skipped;
+  for (const auto &r : orchestrator.Run()) {
+    std::cout << "Post-install for device " << r.first << ": " << JobResultToString(r.second) << std::endl;
+    const InstallJournal::EcuState &state = ecus.at(r.first);
+    if (r.second == InstallOrchestrator::JobResult::kSkipped && state.installed) {
+      LOG_ERROR << "Secondary " << r.first << " has its new firmware but its post-install steps were skipped; "
+                << "they will be retried on the next start or install";
+      skipped.emplace(r.first, state);
+    }
+  }
+  // Failed Secondaries are closed for good, skipped ones stay pending
+  journal_.Clear();
+  for (const auto &s : skipped) {
+    journal_.RecordPending(s.first, s.second);
+  }
+  journal_.Commit();
+}
+
+bool UpdateInstaller::postInstall(const SecondaryInstallSpec &spec, const InstallJournal::EcuState &state) {
+  if (!state.installed) {
+    if (state.expected.empty()) {
+      LOG_INFO << "No updates for Secondary " << spec.ecu_serial;
+      return true;
+    }
+    LOG_ERROR << "Install on Secondary " << spec.ecu_serial << " failed, skipping its post-install stages";
+    return false;
+  }
+  // Reinstalling the same image leaves nothing to do; an unknown old hash counts as changed
+  if (state.hash_before != kUnknownHash && state.hash_before == Sha256File(spec.firmware_path)) {
+    LOG_INFO << "Firmware of Secondary " << spec.ecu_serial << " is unchanged, skipping its post-install stages";
+    return true;
+  }
+
+  if (state.steps_done == 0) {
+    LOG_INFO << "Running post-install steps for Secondary " << spec.ecu_serial;
+  } else {
+    LOG_INFO << "Resuming post-install steps for Secondary " << spec.ecu_serial << " at step " << state.steps_done + 1;
+  }
+  const HookContext context{spec.ecu_serial, spec.firmware_path, state.expected};
+  for (size_t i = state.steps_done; i < spec.post_install.size(); ++i) {
+    if (!spec.post_install[i].Run(context)) {
+      LOG_ERROR << "Post-install stage " << spec.post_install[i].name << " for Secondary " << spec.ecu_serial
+                << " failed";
+      return false;
+    }
+    journal_.RecordStep(spec.ecu_serial, i);
+    journal_.Commit();
+  }
+  LOG_INFO << "Post-install steps completed for Secondary " << spec.ecu_serial;
+  return true;
+}
@@ -0,0 +1,70 @@
+#ifndef UPDATE_INSTALLER_H_
+#define UPDATE_INSTALLER_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/signals2.hpp>
+
+#include "primary/aktualizr.h"
+
+#include "install_journal.h"
+#include "post_install_hooks.h"
+
+// Per-Secondary install description, read from the Secondary config file.
+struct SecondaryInstallSpec {
+  std::string ecu_serial;
+  boost::filesystem::path firmware_path;
+  // Serials of the Secondaries whose post-install steps must complete first.
+  std::vector<std::string> install_after;
+  // Stages run once the firmware file has changed.
+  std::vector<HookStage> post_install;
+};
+
+/*
+ * Installs a batch of updates through libaktualizr and then runs the
+ * post-install steps of every Secondary it reports as successfully updated
+ * and whose firmware changed, in parallel
+ * where the configured ordering allows it. Progress is journaled so that
+ * steps interrupted by a power loss can be resumed on the next start.
+ */
+class UpdateInstaller {
+ public:
+  UpdateInstaller(Aktualizr &aktualizr, std::vector<SecondaryInstallSpec> secondaries, unsigned int max_parallel,
+                  const boost::filesystem::path &journal_path);
+
+  // Safe to call from several threads; installs are serialised.
+  void Install(const std::vector<Uptane::Target> &updates);
+
+  // Finishes the post-install steps left unfinished by the previous run.
+  // Secondaries whose install was interrupted are left for libaktualizr to re-install.
+  void Resume();
+
+  // Runs the stage called stage_name of a Secondary's post-install pipeline outside of an
+  // install, or the whole pipeline if it has no such stage. Not journaled.
+  bool RunPostInstallStages(const std::string &ecu_serial, const std::string &stage_name);
+
+ private:
+  void onEvent(const std::shared_ptr<event::BaseEvent> &event);
+  // True if the Secondary's firmware file already has the expected hash.
+  bool firmwareMatches(const std::string &ecu_serial, const std::string &expected) const;
+  void runPostInstall(const std::map<std::string, InstallJournal::EcuState> &ecus);
+  bool postInstall(const SecondaryInstallSpec &spec, const InstallJournal::EcuState &state);
+
+  Aktualizr &aktualizr_;
+  std::vector<SecondaryInstallSpec> secondaries_;
+  unsigned int max_parallel_;
+  InstallJournal journal_;
+  std::mutex install_mutex_;
+
+  // Per-ECU outcome reported by libaktualizr during the current install
+  std::mutex results_mutex_;
+  std::map<std::string, bool> install_results_;
+  bool installing_{false};
+  boost::signals2::scoped_connection conn_;
+};
+
+#endif  // UPDATE_INSTALLER_H_
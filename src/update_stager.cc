@@ -0,0 +1,220 @@
+#include "update_stager.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
+
+#include "logging/logging.h"
+#include "sha256.h"
+
+namespace {
+
+// ioprio_set() has no glibc wrapper, see linux/ioprio.h
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassIdle = 3;
+constexpr int kIoprioClassShift = 13;
+
+// Applies to the calling thread only, libaktualizr's own threads are left alone.
+void lowerThreadPriority() {
+  const auto tid = static_cast<id_t>(syscall(SYS_gettid));
+  if (syscall(SYS_ioprio_set, kIoprioWhoProcess, tid, kIoprioClassIdle << kIoprioClassShift) != 0) {
+    LOG_WARNING << "Could not set idle I/O priority for the staging thread";
+  }
+  if (setpriority(PRIO_PROCESS, tid, 19) != 0) {
+    LOG_WARNING << "Could not lower CPU priority for the staging thread";
+  }
+}
+
+}  // namespace
+
+MaintenanceWindow MaintenanceWindow::Parse(const std::string &spec) {
+  int start_h, start_m, end_h, end_m;
+  char tail;
+  if (sscanf(spec.c_str(), "%d:%d-%d:%d%c", &start_h, &start_m, &end_h, &end_m, &tail) != 4 || start_h < 0 ||
+      start_h > 23 || end_h < 0 || end_h > 23 || start_m < 0 || start_m > 59 || end_m < 0 || end_m > 59) {
+    throw std::invalid_argument("Invalid maintenance window, expected HH:MM-HH:MM: " + spec);
+  }
+  if (start_h == end_h && start_m == end_m) {
+    throw std::invalid_argument("Maintenance window must not start and end at the same time: " + spec);
+  }
+  return MaintenanceWindow(start_h * 60 + start_m, end_h * 60 + end_m);
+}
+
+bool MaintenanceWindow::Contains(std::time_t t) const {
+  struct tm local {};
+  localtime_r(&t, &local);
+  const int now = local.tm_hour * 60 + local.tm_min;
+  if (start_ < end_) {
+    return now >= start_ && now < end_;
+  }
+  return now >= start_ || now < end_;
+}
+
+UpdateStager::UpdateStager(Aktualizr &aktualizr, UpdateInstaller &installer,
+                           std::unique_ptr<MaintenanceWindow> window)
+    : aktualizr_(aktualizr), installer_(installer), window_(std::move(window)) {
+  staging_thread_ = std::thread([this]() { runStaging(); });
+  if (window_) {
+    install_thread_ = std::thread([this]() { runInstalls(); });
+  }
+  conn_ = aktualizr_.SetSignalHandler([this](const std::shared_ptr<event::BaseEvent> &event) { onEvent(event); });
+}
+
+UpdateStager::~UpdateStager() {
+  conn_.disconnect();
+  {
+    std::lock_guard<std::mutex> guard(m_);
+    shutdown_ = true;
+  }
+  cv_.notify_all();
+  staging_thread_.join();
+  if (install_thread_.joinable()) {
+    install_thread_.join();
+  }
+}
+
+void UpdateStager::onEvent(const std::shared_ptr<event::BaseEvent> &event) {
+  if (!event->isTypeOf<event::CampaignCheckComplete>()) {
+    return;
+  }
+  const auto check_complete = dynamic_cast<event::CampaignCheckComplete *>(event.get());
+  std::lock_guard<std::mutex> guard(m_);
+  for (const auto &c : check_complete->result.campaigns) {
+    if (seen_.insert(c.id).second) {
+      campaigns_.push_back(c.id);
+    }
+  }
+  if (!campaigns_.empty()) {
+    cv_.notify_all();
+  }
+}
+
+std::vector<Uptane::Target> UpdateStager::TakeStaged() {
+  std::lock_guard<std::mutex> guard(m_);
+  std::vector<Uptane::Target> staged;
+  staged.swap(staged_);
+  return staged;
+}
+
+void UpdateStager::runStaging() {
+  // Only this thread's own work (verification) runs at low priority: Download() is executed on
+  // libaktualizr's thread and installs happen on runInstalls().
+  lowerThreadPriority();
+
+  std::unique_lock<std::mutex> lock(m_);
+  while (true) {
+    cv_.wait(lock, [this]() { return shutdown_ || !campaigns_.empty(); });
+    if (shutdown_) {
+      break;
+    }
+
+    std::vector<std::string> ids(campaigns_.begin(), campaigns_.end());
+    campaigns_.clear();
+    lock.unlock();
+    bool staged = false;
+    try {
+      staged = stage(ids);
+    } catch (const std::exception &e) {
+      LOG_ERROR << "Staging of campaign updates failed: " << e.what();
+    }
+    lock.lock();
+    if (!staged) {
+      // Forget the campaigns so that the next CampaignCheck stages them again
+      for (const auto &id : ids) {
+        seen_.erase(id);
+      }
+      LOG_WARNING << "Campaigns will be staged again on the next CampaignCheck";
+    }
+    cv_.notify_all();
+  }
+}
+
+void UpdateStager::runInstalls() {
+  std::unique_lock<std::mutex> lock(m_);
+  while (true) {
+    cv_.wait_for(lock, std::chrono::seconds(30));
+    if (shutdown_) {
+      break;
+    }
+    if (staged_.empty() || !window_->Contains(std::time(nullptr))) {
+      continue;
+    }
+
+    std::vector<Uptane::Target> updates;
+    updates.swap(staged_);
+    lock.unlock();
+    LOG_INFO << "Maintenance window open, installing " << updates.size() << " staged update(s)";
+    try {
+      installer_.Install(updates);
+      // Force to check again for updates, since otherwise the update procedure is not complete on server side
+      aktualizr_.CheckUpdates().get();
+    } catch (const std::exception &e) {
+      LOG_ERROR << "Installation of staged updates failed: " << e.what();
+    }
+    lock.lock();
+  }
+}
+
+bool UpdateStager::stage(const std::vector<std::string> &campaign_ids) {
+  for (const auto &id : campaign_ids) {
+    LOG_INFO << "Accepting campaign " << id << " for staging";
+    aktualizr_.CampaignControl(id, campaign::Cmd::Accept).get();
+  }
+
+  auto result = aktualizr_.CheckUpdates().get();
+  if (result.updates.empty()) {
+    return true;
+  }
+  aktualizr_.Download(result.updates).get();
+
+  std::vector<Uptane::Target> verified;
+  for (const auto &target : result.updates) {
+    if (verify(target)) {
+      verified.push_back(target);
+    } else {
+      LOG_ERROR << "Staged target " << target.filename() << " failed verification, not staging it";
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(m_);
+  for (const auto &target : verified) {
+    bool known = false;
+    for (const auto &s : staged_) {
+      known = known || s.sha256Hash() == target.sha256Hash();
+    }
+    if (!known) {
+      staged_.push_back(target);
+    }
+  }
+  LOG_INFO << staged_.size() << " update(s) staged"
+           << (window_ ? " for the maintenance window" : ", waiting for the Install command");
+  return verified.size() == result.updates.size();
+}
+
+bool UpdateStager::verify(const Uptane::Target &target) {
+  std::unique_ptr<StorageTargetRHandle> handle;
+  try {
+    handle = aktualizr_.OpenStoredTarget(target);
+  } catch (const std::exception &e) {
+    LOG_ERROR << "Staged target " << target.filename() << " not found: " << e.what();
+    return false;
+  }
+
+  Sha256 hasher;
+  std::vector<uint8_t> buffer(64 * 1024);
+  uint64_t total = 0;
+  size_t n;
+  while ((n = handle->rread(buffer.data(), buffer.size())) > 0) {
+    hasher.Update(buffer.data(), n);
+    total += n;
+  }
+  handle->rclose();
+
+  return total == target.length() && boost::algorithm::iequals(hasher.HexDigest(), target.sha256Hash());
+}
@@ -0,0 +1,77 @@
+#ifndef UPDATE_STAGER_H_
+#define UPDATE_STAGER_H_
+
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/signals2.hpp>
+
+#include "primary/aktualizr.h"
+
+#include "update_installer.h"
+
+// Daily local-time window, e.g. "02:00-04:30". May wrap around midnight.
+class MaintenanceWindow {
+ public:
+  static MaintenanceWindow Parse(const std::string &spec);
+
+  bool Contains(std::time_t t) const;
+
+ private:
+  MaintenanceWindow(int start, int end) : start_(start), end_(end) {}
+
+  int start_;  // minutes since midnight
+  int end_;
+};
+
+/*
+ * Pre-fetches campaign updates in the background: as soon as a campaign
+ * check reports campaigns, they are accepted, their targets downloaded and
+ * verified against the Uptane hashes. Only the verification runs at idle
+ * I/O priority; libaktualizr downloads on its own thread at normal priority.
+ * The staged targets are then installed at normal priority by a separate
+ * thread inside the maintenance window, or handed over to the Install
+ * command when no window is configured.
+ */
+class UpdateStager {
+ public:
+  UpdateStager(Aktualizr &aktualizr, UpdateInstaller &installer, std::unique_ptr<MaintenanceWindow> window);
+  ~UpdateStager();
+  UpdateStager(const UpdateStager &) = delete;
+  UpdateStager &operator=(const UpdateStager &) = delete;
+
+  // Returns the verified targets waiting for installation and forgets them.
+  std::vector<Uptane::Target> TakeStaged();
+
+ private:
+  // Called from the libaktualizr event handler, so it must not block.
+  void onEvent(const std::shared_ptr<event::BaseEvent> &event);
+  void runStaging();
+  void runInstalls();
+  // Returns false if a target failed verification; throws on libaktualizr errors.
+  bool stage(const std::vector<std::string> &campaign_ids);
+  bool verify(const Uptane::Target &target);
+
+  Aktualizr &aktualizr_;
+  UpdateInstaller &installer_;
+  std::unique_ptr<MaintenanceWindow> window_;
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::deque<std::string> campaigns_;
+  std::set<std::string> seen_;
+  std::vector<Uptane::Target> staged_;
+  bool shutdown_{false};
+  std::thread staging_thread_;
+  std::thread install_thread_;
+  boost::signals2::scoped_connection conn_;
+};
+
+#endif  // UPDATE_STAGER_H_